@@ -0,0 +1,99 @@
+import os
+import sys
+import time
+
+# Checks against the simulated board that a friction calibration keeps the
+# handle within a bounded travel and brings it back to where it started, that
+# the spring then pulls the handle back from a small displacement, and that a
+# zero controller command leaves it there. Needs the images
+# from sim_SConstruct; run with
+# >python calibration_check.py
+
+os.environ.setdefault('MP2_SIM_FAST', '1')
+import mp2_sim as usb
+
+SET_PARAMETER = 6
+CALIBRATE = 12
+GET_CALIBRATION = 13
+
+# Controller modes and the parameter index that selects them
+SPRING = 0
+DAMPER = 1
+WALL = 3
+OFF = 4
+MODE_INDEX = 4
+
+MAX_EXCURSION = 6.2832  # rad the calibration may move the handle from its start
+RETURN_TOL = 0.03       # rad from the start the handle must end up
+NUDGE_TORQUE = 5e-3     # N m, just past the simulated static friction
+NUDGE = 0.1             # rad to push the handle off zero before the spring takes it
+SPRING_TIME = 2.0       # Simulated seconds the spring gets to bring it back
+SPRING_TOL = 0.02       # rad from zero it must then be
+HOLD_TIME = 5.0         # Simulated seconds the handle must stay put at zero
+MAX_DRIFT = 0.01        # rad
+
+def toWord(byteArray):
+    val = 0
+    for i,byte in enumerate(byteArray):
+        val += int(byte) * 2**(8*i)
+    return val
+
+def set_mode(dev, mode):
+    dev.ctrl_transfer(0x40, SET_PARAMETER, toWord((mode, MODE_INDEX)), 0)
+
+def wait(dev, seconds):
+    start = dev.time()
+    while dev.time() - start < seconds:
+        time.sleep(0.01)
+
+def nudge(dev, home, sign):
+    # Push the handle just off zero with the motor off and let it stop
+    set_mode(dev, OFF)
+    dev.set_user_torque(sign * NUDGE_TORQUE)
+    while abs(dev.angle() - home) < NUDGE:
+        time.sleep(0.0005)
+    dev.set_user_torque(0.0)
+    wait(dev, 0.5)
+    return dev.angle() - home
+
+dev = usb.core.find(idVendor = 0x6666, idProduct = 0x0003)
+dev.set_configuration()
+
+set_mode(dev, OFF)
+home = dev.angle()
+excursion = 0.0
+dev.ctrl_transfer(0x40, CALIBRATE, 0, 0)
+while dev.ctrl_transfer(0xC0, GET_CALIBRATION, 0, 0, 2)[0]:
+    excursion = max(excursion, abs(dev.angle() - home))
+    time.sleep(0.001)
+result = dev.ctrl_transfer(0xC0, GET_CALIBRATION, 0, 0, 2)[1]
+if result != 1:
+    print('Calibration did not finish (result {})'.format(result))
+    sys.exit(1)
+
+offset = dev.angle() - home
+failed = excursion > MAX_EXCURSION or abs(offset) > RETURN_TOL
+print('calibration moved up to {:.3f} rad, ended {:+.4f} rad from start  {}'.format(
+    excursion, offset, 'FAILED' if failed else 'ok'))
+
+# Small spring commands must still move the handle
+for sign in (1, -1):
+    pushed = nudge(dev, home, sign)
+    set_mode(dev, SPRING)
+    wait(dev, SPRING_TIME)
+    offset = dev.angle() - home
+    ok = abs(offset) < SPRING_TOL
+    failed = failed or not ok
+    print('spring from {:+.3f} rad back to {:+.4f} rad  {}'.format(pushed, offset, 'ok' if ok else 'FAILED'))
+
+# The handle is back at zero, where every controller below commands nothing
+for name, mode in [('spring', SPRING), ('wall', WALL), ('damper', DAMPER), ('off', OFF)]:
+    set_mode(dev, mode)
+    start = dev.angle()
+    wait(dev, HOLD_TIME)
+    drift = dev.angle() - start
+    ok = abs(drift) < MAX_DRIFT
+    failed = failed or not ok
+    print('{:7s} drift {:+.4f} rad  {}'.format(name, drift, 'ok' if ok else 'FAILED'))
+
+sys.exit(1 if failed else 0)
@@ -24,17 +24,17 @@
 _PIN *ENC_SCK, *ENC_MISO, *ENC_MOSI;
 _PIN *ENC_NCS;
 
-WORD OFFSET = (WORD) 0;
-WORD CURRENT_ANGLE = (WORD) 0;
-WORD LAST_ANGLE = (WORD) 0;
-WORD UNWRAPPED_ANGLE = (WORD) 0;
-WORD VELOCITY = (WORD) 0;
+WORD OFFSET = {0};
+WORD CURRENT_ANGLE = {0};
+WORD LAST_ANGLE = {0};
+WORD UNWRAPPED_ANGLE = {0};
+WORD VELOCITY = {0};
 int8_t WRAPS = 0;
 
-WORD CURRENT_CURRENT = (WORD) 0;
-WORD LAST_CURRENT = (WORD) 0;
+WORD CURRENT_CURRENT = {0};
+WORD LAST_CURRENT = {0};
 
-WORD CURRENT_SPEED = (WORD) 0;
+WORD CURRENT_SPEED = {0};
 uint8_t CURRENT_DIRECTION = 0;
 
 uint8_t K_DAMPER = 1;
@@ -72,7 +72,7 @@ void check_wraps() {
 }
 
 void get_raw_angle() {
-    WORD result = enc_readReg((WORD) REG_ANG_ADDR);
+    WORD result = enc_readReg((WORD) {.w = REG_ANG_ADDR});
     // If the parity of the result is wrong, don't use the result
     if (parity(result.w)) {
         CURRENT_ANGLE = LAST_ANGLE;
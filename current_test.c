@@ -11,8 +11,8 @@
 #define GET_CURRENT 1
 #define GET_LAST    2
 
-WORD CURRENT_CURRENT = (WORD) 0;
-WORD LAST_CURRENT = (WORD) 0;
+WORD CURRENT_CURRENT = {0};
+WORD LAST_CURRENT = {0};
 
 void VendorRequests(void) {
     switch (USB_setup.bRequest) {
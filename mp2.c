@@ -23,6 +23,14 @@
 #define GET_SPEED       4
 #define GET_DIRECTION   5
 #define SET_PARAMETER   6
+#define GET_STATS       7
+#define SET_STATS_WINDOW 8
+#define GET_OBSERVER    9
+#define GET_OBSERVER_COST 10
+#define GET_TASK_STATS  11
+#define CALIBRATE       12
+#define GET_CALIBRATION 13
+#define SET_CALIBRATION 14
 
 // Control scheme encoding
 #define SPRING      0
@@ -30,19 +38,70 @@
 #define TEXTURE     2
 #define WALL        3
 
+// Windowed statistics channels
+#define STAT_CURRENT    0
+#define STAT_ANGLE      1
+#define STAT_VELOCITY   2
+#define NUM_STATS       3
+#define STATS_MAX_WINDOW 1023    // Keeps the scaled sum of squares in 32 bits
+
+// Motor model for the state observer. These are the values the simulator in
+// sim/plant.c uses; they have not been measured on the real board yet.
+#define MOTOR_KT        0.02    // Torque constant, N m / A
+#define MOTOR_INERTIA   2e-5    // Rotor and handle, kg m^2
+#define CUR_SENSE_GAIN  (0.75 / 3.3 * 65536)    // ADC counts per A (0.75 V/A)
+#define ENC_COUNTS_PER_RAD (16384 / 6.2831853)
+
+// State observer; quantities are per reading tick in fixed point
+// Acceleration per current count, in counts per tick^2, Q24:
+// KT / INERTIA [rad/s^2 per A] * counts per rad / counts per A / READ_FREQ^2 * 2^24
+#define OBS_K_CURRENT   ((int32_t) (MOTOR_KT / MOTOR_INERTIA * ENC_COUNTS_PER_RAD \
+                                    / CUR_SENSE_GAIN / READ_FREQ / READ_FREQ * 16777216.0 + 0.5))
+#define OBS_L_ANGLE     1999    // Correction gains for observer poles at 0.8:
+#define OBS_L_VELOCITY  459     //   angle and velocity in Q12,
+#define OBS_L_DIST      8389    //   disturbance in Q20
+#define OBS_MAX_ERROR   ((int32_t) 512 << 8)
+
+// Friction calibration; ticks are control ticks
+#define DEAD_ZONE       0x1000  // Compensation used until calibrated
+#define CAL_IDLE        0
+#define CAL_RAMP        1
+#define CAL_HOLD_LOW    2
+#define CAL_HOLD_HIGH   3
+#define CAL_SETTLE      4
+#define CAL_RETURN      5
+#define CAL_NONE        0
+#define CAL_DONE        1
+#define CAL_FAILED      2
+#define CAL_RAMP_STEP   0x0040  // Duty added per tick while looking for breakaway
+#define CAL_MOVE_VEL    64      // OBS_VELOCITY above this counts as moving
+#define CAL_MOVE_TICKS  3       // Consecutive moving ticks that mark breakaway
+#define CAL_LOW_VEL     163     // Hold speeds for the friction fit, ~1 and ~4 rad/s
+#define CAL_HIGH_VEL    652
+#define CAL_SPEED_KP    2       // Duty per OBS_VELOCITY unit of speed error
+#define CAL_SPEED_KI    4       // Same, added every tick, Q4
+#define CAL_HOLD_TICKS  80      // Second half of each hold is averaged
+#define CAL_MAX_TRAVEL  0x3000  // Hold ends early past this distance from its start
+#define CAL_SETTLE_TICKS 50
+#define CAL_RETURN_GAIN 4       // Counts from the start point per unit of return speed
+#define CAL_RETURN_TOL  0x0040  // Counts from the start point that end the return
+#define CAL_RETURN_TICKS 500    // Give up returning after this long
+#define CAL_FF_START    0x0020  // Commands from this up switch the feed-forward on,
+#define CAL_FF_STOP     0x0010  //   and below this switch it off again
+
 // SPI pins
 _PIN *ENC_SCK, *ENC_MISO, *ENC_MOSI;
 _PIN *ENC_NCS;
 
 // Readings
-WORD ANG_OFFSET = (WORD) 0;
-WORD ANGLE = (WORD) 0;
-WORD LAST_ANGLE = (WORD) 0;
-WORD UNWRAPPED_ANGLE = (WORD) 0;
+WORD ANG_OFFSET = {0};
+WORD ANGLE = {0};
+WORD LAST_ANGLE = {0};
+WORD UNWRAPPED_ANGLE = {0};
 int8_t WRAPS = 0;
-WORD CURRENT = (WORD) 0;
-WORD VELOCITY = (WORD) 0;
-WORD MD_SPEED = (WORD) 0;
+WORD CURRENT = {0};
+WORD VELOCITY = {0};
+WORD MD_SPEED = {0};
 uint8_t MD_DIRECTION = 0;
 
 // Control parameters
@@ -70,6 +129,64 @@ uint8_t TEX_NUM_BUMPS = sizeof(TEX_BUMPS)/sizeof(TEX_BUMPS[0]);
 uint16_t WALL_SPEED = 0x4000;
 int16_t WALL_LOCATION = 0x2000;
 
+// Windowed statistics
+typedef struct {
+    int16_t min;
+    int16_t max;
+    int32_t sum;
+    uint32_t sum_sq;    // Sum of squares, each scaled down by 2^8
+} _STATS_ACC;
+
+typedef struct {
+    WORD min;
+    WORD max;
+    WORD mean;
+    WORD rms;
+} _STATS;
+
+// State observer
+int32_t OBS_POS = 0;            // counts, Q8
+int32_t OBS_VEL = 0;            // counts per tick, Q16
+int32_t OBS_DIST = 0;           // External acceleration, counts per tick^2, Q24
+WORD OBS_ANGLE = {0};      // Same units as UNWRAPPED_ANGLE
+WORD OBS_VELOCITY = {0};   // Same units as VELOCITY
+WORD OBS_ACCEL = {0};      // counts per tick^2, Q10
+WORD OBS_TORQUE = {0};     // External torque, in equivalent current counts
+uint16_t OBS_COST = 0;          // timer2 counts taken by the last update
+uint16_t OBS_COST_MAX = 0;
+
+// Friction calibration; index 0 and 1 are the two motor directions
+uint8_t CAL_STATE = CAL_IDLE;
+uint8_t CAL_RESULT = CAL_NONE;
+uint8_t CAL_DIR = 0;
+uint16_t CAL_DUTY = 0;
+uint16_t CAL_TICKS = 0;
+uint8_t CAL_MOVING = 0;
+int32_t CAL_EFFORT = 0;         // Speed loop integrator, signed duty in Q4
+WORD CAL_START_ANGLE = {0};     // UNWRAPPED_ANGLE when the calibration started
+WORD CAL_HOLD_ANGLE = {0};      // and when the current hold started
+uint8_t CAL_SAMPLES = 0;
+int16_t CAL_STALL_CURRENT = 0;
+int32_t CAL_SUM_CURRENT = 0;
+int32_t CAL_SUM_VELOCITY = 0;
+int32_t CAL_SUM_DUTY = 0;
+int16_t CAL_LOW_CURRENT = 0;
+int16_t CAL_LOW_VELOCITY = 0;
+int32_t CAL_LOW_DUTY = 0;
+uint16_t CAL_BREAKAWAY[] = {DEAD_ZONE, DEAD_ZONE};  // Duty that starts the motor
+int16_t CAL_BREAKAWAY_CURRENT[] = {0, 0};
+int16_t CAL_COULOMB[] = {0, 0};         // Coulomb friction, in current counts
+int16_t CAL_VISCOUS[] = {0, 0};         // Current counts per OBS_VELOCITY unit, Q8
+uint16_t CAL_COULOMB_DUTY[] = {DEAD_ZONE, DEAD_ZONE};  // Duty that balances it
+int16_t CAL_SPEED_DUTY[] = {0, 0};      // Further duty per OBS_VELOCITY unit, Q8
+uint8_t CAL_FF_ACTIVE = 0;
+
+uint16_t STATS_WINDOW = 102;    // ~100 ms at READ_FREQ
+uint16_t STATS_COUNT = 0;
+WORD STATS_SEQ = {0};      // Incremented every time a window completes
+_STATS_ACC STATS_ACC[NUM_STATS];
+_STATS STATS[NUM_STATS];
+
 WORD enc_readReg(WORD address) {
     /*
     Given an address, return the value from the encoder's register at that address
@@ -92,6 +209,133 @@ WORD enc_readReg(WORD address) {
     return result;
 }
 
+uint16_t isqrt(uint32_t value) {
+    /*
+    Return the square root of value, rounded to the nearest integer
+    */
+    uint32_t root = 0;
+    uint32_t bit = (uint32_t) 1 << 30;
+    while (bit > value) {
+        bit >>= 2;
+    }
+    while (bit) {
+        if (value >= root + bit) {
+            value -= root + bit;
+            root = (root >> 1) + bit;
+        } else {
+            root >>= 1;
+        }
+        bit >>= 2;
+    }
+    // value now holds value - root^2; round up past (root + 1/2)^2
+    if (value > root) {
+        root += 1;
+    }
+    return (uint16_t) root;
+}
+
+void reset_stats() {
+    /*
+    Clear the accumulators and start a new statistics window
+    */
+    uint8_t i;
+    for (i = 0; i < NUM_STATS; ++i) {
+        STATS_ACC[i].min = INT16_MAX;
+        STATS_ACC[i].max = INT16_MIN;
+        STATS_ACC[i].sum = 0;
+        STATS_ACC[i].sum_sq = 0;
+    }
+    STATS_COUNT = 0;
+}
+
+void accumulate_stat(_STATS_ACC *acc, int16_t value) {
+    /*
+    Add a single sample to a statistics accumulator
+    */
+    if (value < acc->min) {
+        acc->min = value;
+    }
+    if (value > acc->max) {
+        acc->max = value;
+    }
+    acc->sum += value;
+    // Scale the square down so a full window of full-scale samples fits in
+    // 32 bits: (-32768)^2 / 2^8 = 2^22, and 1023 * 2^22 < 2^32, but 1024
+    // of them would wrap to exactly 0. Round rather than truncate.
+    acc->sum_sq += ((uint32_t) ((int32_t) value * value) + 128) >> 8;
+}
+
+void update_stats() {
+    /*
+    Accumulate the latest readings and publish the window once it is full
+    */
+    uint8_t i;
+    accumulate_stat(&STATS_ACC[STAT_CURRENT], CURRENT.i);
+    accumulate_stat(&STATS_ACC[STAT_ANGLE], UNWRAPPED_ANGLE.i);
+    accumulate_stat(&STATS_ACC[STAT_VELOCITY], VELOCITY.i);
+
+    if (++STATS_COUNT < STATS_WINDOW) {
+        return;
+    }
+    for (i = 0; i < NUM_STATS; ++i) {
+        STATS[i].min.i = STATS_ACC[i].min;
+        STATS[i].max.i = STATS_ACC[i].max;
+        STATS[i].mean.i = (int16_t) (STATS_ACC[i].sum / (int32_t) STATS_COUNT);
+        // Undo the 2^8 scaling of the squares before the root; the mean
+        // scaled square is at most 2^22, so this still fits in 32 bits
+        STATS[i].rms.w = isqrt((STATS_ACC[i].sum_sq / STATS_COUNT) << 8);
+        // RMS can never be below |mean|; the scaling can only lose that for
+        // values of a count or two
+        uint16_t magnitude = abs(STATS[i].mean.i);
+        if (STATS[i].rms.w < magnitude) {
+            STATS[i].rms.w = magnitude;
+        }
+    }
+    STATS_SEQ.w += 1;
+    reset_stats();
+}
+
+void update_observer() {
+    /*
+    Fuse the unwrapped angle and motor current into estimates of angle,
+    velocity, acceleration, and the external torque acting on the handle
+    */
+    // Predict one tick ahead, driven by the measured motor current
+    int32_t accel = (int32_t) CURRENT.i * OBS_K_CURRENT + OBS_DIST;
+    OBS_POS += OBS_VEL >> 8;
+    OBS_VEL += accel >> 8;
+
+    // Correct with the encoder. The difference is taken in 16 bits so that
+    // it follows UNWRAPPED_ANGLE when that rolls over.
+    int16_t delta = UNWRAPPED_ANGLE.w - (uint16_t) (OBS_POS >> 8);
+    int32_t error = ((int32_t) delta << 8) - (OBS_POS & 0xFF);
+    if (error > OBS_MAX_ERROR) {
+        error = OBS_MAX_ERROR;
+    } else if (error < -OBS_MAX_ERROR) {
+        error = -OBS_MAX_ERROR;
+    }
+    OBS_POS += (OBS_L_ANGLE * error) >> 12;
+    OBS_VEL += (OBS_L_VELOCITY * error) >> 4;
+    OBS_DIST += (OBS_L_DIST * error) >> 4;
+
+    // Keep the integer part of the angle in 16 bits, like UNWRAPPED_ANGLE
+    OBS_POS = ((int32_t) (int16_t) (OBS_POS >> 8) << 8) | (OBS_POS & 0xFF);
+
+    OBS_ANGLE.i = OBS_POS >> 8;
+    OBS_VELOCITY.i = OBS_VEL >> 10;
+    OBS_ACCEL.i = ((int32_t) CURRENT.i * OBS_K_CURRENT + OBS_DIST) >> 14;
+    OBS_TORQUE.i = OBS_DIST / OBS_K_CURRENT;
+
+    // Once calibrated, take the friction out so only the user's torque is left
+    if (CAL_RESULT == CAL_DONE) {
+        if (OBS_VELOCITY.i > CAL_MOVE_VEL) {
+            OBS_TORQUE.i += CAL_COULOMB[0] + (((int32_t) CAL_VISCOUS[0] * OBS_VELOCITY.i) >> 8);
+        } else if (OBS_VELOCITY.i < -CAL_MOVE_VEL) {
+            OBS_TORQUE.i -= CAL_COULOMB[1] - (((int32_t) CAL_VISCOUS[1] * OBS_VELOCITY.i) >> 8);
+        }
+    }
+}
+
 void get_readings() {
     /*
     Get readings for current, raw angle, wraps, unwrapped angle, and velocity
@@ -101,7 +345,7 @@ void get_readings() {
 
     // Read the encoder, check parity, and subtract initial offset
     LAST_ANGLE = ANGLE;
-    WORD result = enc_readReg((WORD) REG_ANG_ADDR);
+    WORD result = enc_readReg((WORD) {.w = REG_ANG_ADDR});
     if (!parity(result.w)) {
         ANGLE.w = ((result.w & ENC_MASK) - ANG_OFFSET.w) & ENC_MASK;
     }
@@ -121,6 +365,18 @@ void get_readings() {
     // Calculate velocity as (change in angle) / (time between readings)
     // Divide by 16 to avoid overflow
     VELOCITY.w = (UNWRAPPED_ANGLE.w - last) * (READ_FREQ / 16);
+
+    // Time the observer against the timer2 period to keep an eye on its cost
+    uint16_t start = timer_read(&timer2);
+    update_observer();
+    uint16_t stop = timer_read(&timer2);
+    if (stop < start) {
+        stop += *(timer2.PRx) + 1;
+    }
+    OBS_COST = stop - start;
+    if (OBS_COST > OBS_COST_MAX) {
+        OBS_COST_MAX = OBS_COST;
+    }
 }
 
 void use_spring() {
@@ -140,12 +396,12 @@ void use_damper() {
     /*
     Calculate the motor commands for the damper controller
     */
-    if (VELOCITY.i > 0) {
+    if (OBS_VELOCITY.i > 0) {
         MD_DIRECTION = 1;
-        MD_SPEED.w = VELOCITY.w;
+        MD_SPEED.w = OBS_VELOCITY.w;
     } else {
         MD_DIRECTION = 0;
-        MD_SPEED.w = -VELOCITY.w;
+        MD_SPEED.w = -OBS_VELOCITY.w;
     }
 }
 
@@ -175,10 +431,264 @@ void use_wall() {
     }
 }
 
+void start_calibration() {
+    /*
+    Start measuring breakaway duty and friction, beginning with direction 0
+    */
+    CAL_STATE = CAL_RAMP;
+    CAL_RESULT = CAL_NONE;
+    CAL_DIR = 0;
+    CAL_DUTY = 0;
+    CAL_TICKS = 0;
+    CAL_MOVING = 0;
+    CAL_START_ANGLE.w = UNWRAPPED_ANGLE.w;
+}
+
+void start_hold(uint8_t state) {
+    /*
+    Hold the motor at a fixed speed while averaging current and velocity
+    */
+    CAL_STATE = state;
+    CAL_TICKS = 0;
+    CAL_SAMPLES = 0;
+    CAL_SUM_CURRENT = 0;
+    CAL_SUM_VELOCITY = 0;
+    CAL_SUM_DUTY = 0;
+    CAL_HOLD_ANGLE.w = UNWRAPPED_ANGLE.w;
+}
+
+void start_return() {
+    /*
+    Stop measuring and drive the handle back to where the calibration started
+    */
+    CAL_STATE = CAL_RETURN;
+    CAL_TICKS = 0;
+    CAL_EFFORT = 0;
+}
+
+void drive_speed(int16_t target) {
+    /*
+    Run the motor at the target OBS_VELOCITY with a PI loop; positive
+    speeds drive the angle up
+    */
+    int16_t error = target - OBS_VELOCITY.i;
+    int32_t command;
+
+    CAL_EFFORT += (int32_t) error * CAL_SPEED_KI;
+    if (CAL_EFFORT > 0xFFFFL << 4) {
+        CAL_EFFORT = 0xFFFFL << 4;
+    } else if (CAL_EFFORT < -(0xFFFFL << 4)) {
+        CAL_EFFORT = -(0xFFFFL << 4);
+    }
+    command = (CAL_EFFORT >> 4) + (int32_t) error * CAL_SPEED_KP;
+
+    if (command >= 0) {
+        CAL_DUTY = (command > 0xFFFF) ? 0xFFFF : command;
+        MD_DIRECTION = 0;
+    } else {
+        CAL_DUTY = (command < -0xFFFF) ? 0xFFFF : -command;
+        MD_DIRECTION = 1;
+    }
+}
+
+void finish_direction(int16_t high_current, int16_t high_velocity, int32_t high_duty) {
+    /*
+    Fit Coulomb and viscous friction, and the duty that overcomes them,
+    through the two holds for CAL_DIR
+    */
+    int16_t d_current = high_current - CAL_LOW_CURRENT;
+    int16_t d_velocity = high_velocity - CAL_LOW_VELOCITY;
+    int16_t viscous = 0;
+    if (d_current > 0 && d_velocity > 0) {
+        viscous = ((int32_t) d_current << 8) / d_velocity;
+    }
+    int16_t coulomb = CAL_LOW_CURRENT - (((int32_t) viscous * CAL_LOW_VELOCITY) >> 8);
+    if (coulomb < 0) {
+        coulomb = 0;
+    }
+    CAL_VISCOUS[CAL_DIR] = viscous;
+    CAL_COULOMB[CAL_DIR] = coulomb;
+
+    // Scale the breakaway duty by the ratio of Coulomb to stall current to
+    // get the duty that just balances friction once moving
+    uint16_t breakaway = CAL_BREAKAWAY[CAL_DIR];
+    int16_t stall = CAL_BREAKAWAY_CURRENT[CAL_DIR];
+    if (stall > coulomb) {
+        CAL_COULOMB_DUTY[CAL_DIR] = (uint32_t) breakaway * coulomb / stall;
+    } else {
+        CAL_COULOMB_DUTY[CAL_DIR] = breakaway;
+    }
+
+    // The extra duty the faster hold needed covers viscous friction and the
+    // motor's back-EMF, both of which grow with speed
+    int16_t speed_duty = 0;
+    if (d_velocity > 0 && high_duty > CAL_LOW_DUTY) {
+        speed_duty = ((high_duty - CAL_LOW_DUTY) << 8) / d_velocity;
+    }
+    CAL_SPEED_DUTY[CAL_DIR] = speed_duty;
+}
+
+void calibrate_step() {
+    /*
+    Advance the calibration by one control tick and command the motor
+    */
+    // Work with speeds and currents in the direction being calibrated
+    int16_t velocity = CAL_DIR ? -OBS_VELOCITY.i : OBS_VELOCITY.i;
+    int16_t current = CAL_DIR ? -CURRENT.i : CURRENT.i;
+    int32_t duty;
+    int16_t travel = UNWRAPPED_ANGLE.w - CAL_HOLD_ANGLE.w;
+    int16_t offset = CAL_START_ANGLE.w - UNWRAPPED_ANGLE.w;
+    int16_t target;
+    CAL_TICKS += 1;
+    MD_DIRECTION = CAL_DIR;
+
+    switch (CAL_STATE) {
+        case CAL_RAMP:
+            if (velocity > CAL_MOVE_VEL) {
+                if (++CAL_MOVING >= CAL_MOVE_TICKS) {
+                    CAL_BREAKAWAY[CAL_DIR] = CAL_DUTY;
+                    CAL_BREAKAWAY_CURRENT[CAL_DIR] = CAL_STALL_CURRENT;
+                    // Carry on from breakaway so the speed loop starts moving
+                    CAL_EFFORT = (int32_t) CAL_DUTY << 4;
+                    if (CAL_DIR) {
+                        CAL_EFFORT = -CAL_EFFORT;
+                    }
+                    start_hold(CAL_HOLD_LOW);
+                }
+            } else if (CAL_DUTY > 0xFFFF - CAL_RAMP_STEP) {
+                // Never broke away; give up and keep the old compensation
+                CAL_RESULT = CAL_FAILED;
+                CAL_BREAKAWAY[0] = CAL_BREAKAWAY[1] = DEAD_ZONE;
+                start_return();
+            } else {
+                CAL_MOVING = 0;
+                CAL_STALL_CURRENT = current;
+                CAL_DUTY += CAL_RAMP_STEP;
+            }
+            break;
+        case CAL_HOLD_LOW:
+        case CAL_HOLD_HIGH:
+            target = (CAL_STATE == CAL_HOLD_LOW) ? CAL_LOW_VEL : CAL_HIGH_VEL;
+            drive_speed(CAL_DIR ? -target : target);
+            duty = (MD_DIRECTION == CAL_DIR) ? CAL_DUTY : -CAL_DUTY;
+            // Skip the first half of the hold while the speed settles
+            if (CAL_TICKS > CAL_HOLD_TICKS / 2) {
+                CAL_SUM_CURRENT += current;
+                CAL_SUM_VELOCITY += velocity;
+                CAL_SUM_DUTY += duty;
+                CAL_SAMPLES += 1;
+            }
+            // Cut the hold short rather than let the handle run away
+            if (CAL_TICKS < CAL_HOLD_TICKS && abs(travel) < CAL_MAX_TRAVEL) {
+                break;
+            }
+            if (CAL_SAMPLES == 0) {
+                CAL_RESULT = CAL_FAILED;
+                CAL_BREAKAWAY[0] = CAL_BREAKAWAY[1] = DEAD_ZONE;
+                start_return();
+            } else if (CAL_STATE == CAL_HOLD_LOW) {
+                CAL_LOW_CURRENT = CAL_SUM_CURRENT / CAL_SAMPLES;
+                CAL_LOW_VELOCITY = CAL_SUM_VELOCITY / CAL_SAMPLES;
+                CAL_LOW_DUTY = CAL_SUM_DUTY / CAL_SAMPLES;
+                start_hold(CAL_HOLD_HIGH);
+            } else {
+                finish_direction(CAL_SUM_CURRENT / CAL_SAMPLES, CAL_SUM_VELOCITY / CAL_SAMPLES,
+                                 CAL_SUM_DUTY / CAL_SAMPLES);
+                CAL_STATE = CAL_SETTLE;
+                CAL_DUTY = 0;
+                CAL_TICKS = 0;
+            }
+            break;
+        case CAL_SETTLE:
+            CAL_DUTY = 0;
+            if (CAL_TICKS < CAL_SETTLE_TICKS) {
+                break;
+            }
+            if (CAL_DIR == 0) {
+                CAL_STATE = CAL_RAMP;
+                CAL_DIR = 1;
+                CAL_TICKS = 0;
+                CAL_MOVING = 0;
+            } else {
+                start_return();
+            }
+            break;
+        case CAL_RETURN:
+            // Head back at a speed proportional to the distance left, so the
+            // spring and wall keep their zero
+            if (abs(offset) <= CAL_RETURN_TOL || CAL_TICKS >= CAL_RETURN_TICKS) {
+                CAL_STATE = CAL_IDLE;
+                if (CAL_RESULT == CAL_NONE) {
+                    CAL_RESULT = CAL_DONE;
+                }
+                CAL_DUTY = 0;
+                break;
+            }
+            target = offset / CAL_RETURN_GAIN;
+            if (target > CAL_HIGH_VEL) {
+                target = CAL_HIGH_VEL;
+            } else if (target < -CAL_HIGH_VEL) {
+                target = -CAL_HIGH_VEL;
+            }
+            drive_speed(target);
+            break;
+    }
+
+    MD_SPEED.w = CAL_DUTY;
+    md_velocity(&md1, MD_SPEED.w, MD_DIRECTION);
+}
+
+uint16_t friction_compensation(uint16_t speed, uint8_t direction) {
+    /*
+    Return the duty to add to a controller command of the given speed, before
+    scaling by K, to make up for the motor's dead zone and friction
+    */
+    if (CAL_RESULT != CAL_DONE) {
+        return DEAD_ZONE;
+    }
+    // Breakaway duty starts the motor on its own, so commands right around
+    // zero must get none of it. The gap between the start and stop
+    // thresholds keeps encoder noise from toggling it.
+    if (speed >= CAL_FF_START) {
+        CAL_FF_ACTIVE = 1;
+    } else if (speed < CAL_FF_STOP) {
+        CAL_FF_ACTIVE = 0;
+    }
+    if (!CAL_FF_ACTIVE) {
+        return 0;
+    }
+
+    // Direction 0 drives the angle up. If the handle is already moving that
+    // way Coulomb friction, viscous friction and back-EMF are left to
+    // overcome; if it is moving the other way friction already acts with
+    // the command.
+    int16_t velocity = direction ? -OBS_VELOCITY.i : OBS_VELOCITY.i;
+    uint32_t duty;
+    if (velocity > CAL_MOVE_VEL) {
+        duty = CAL_COULOMB_DUTY[direction];
+        if (CAL_SPEED_DUTY[direction] > 0) {
+            duty += ((uint32_t) CAL_SPEED_DUTY[direction] * velocity) >> 8;
+        }
+        if (duty > 0xFFFF) {
+            duty = 0xFFFF;
+        }
+    } else if (velocity < -CAL_MOVE_VEL) {
+        duty = 0;
+    } else {
+        duty = CAL_BREAKAWAY[direction];
+    }
+    return duty;
+}
+
 void set_velocity() {
     /*
     Set the velocity of the motor using one of the control schemes
     */
+    if (CAL_STATE != CAL_IDLE) {
+        calibrate_step();
+        return;
+    }
+
     uint8_t mode = PARAMETERS[4];
     switch (mode) {
         case SPRING:
@@ -200,12 +710,157 @@ void set_velocity() {
     }
 
     // Multiply by appropriate K value and compensate for the dead zone
-    MD_SPEED.w = MD_SPEED.w * PARAMETERS[mode] + 0x1000;
+    // and friction in the commanded direction, saturating at full duty
+    uint32_t speed = (uint32_t) MD_SPEED.w * PARAMETERS[mode] +
+                     friction_compensation(MD_SPEED.w, MD_DIRECTION);
+    MD_SPEED.w = (speed > 0xFFFF) ? 0xFFFF : speed;
 
     // Command motor
     md_velocity(&md1, MD_SPEED.w, MD_DIRECTION);
 }
 
+// Scheduler
+typedef struct {
+    void (*run)(void);
+    uint8_t budget_pct;     // Allowed run time, in percent of a reading tick
+    uint16_t budget;        // Allowed run time, in timer2 counts
+    uint32_t runs;
+    uint16_t overruns;      // Runs that took longer than the budget
+    uint16_t cost_max;      // Longest run, in timer2 counts
+} _TASK;
+
+typedef struct {
+    _TIMER *timer;          // Releases the group; NULL runs it whenever idle
+    uint8_t first_task;
+    uint8_t num_tasks;
+    volatile uint16_t released; // Releases so far, counted from the timer interrupt
+    uint16_t handled;       // Releases the group has started on
+    uint16_t misses;        // Releases that came before the group finished the last one
+} _RATE_GROUP;
+
+// Tasks, in priority order within each rate group
+_TASK TASKS[] = {
+    {get_readings, 40},     // Sensing
+    {update_stats, 10},     // Telemetry
+    {set_velocity, 20},     // Control
+    {ServiceUSB, 100}       // USB
+};
+uint8_t NUM_TASKS = sizeof(TASKS)/sizeof(TASKS[0]);
+
+// Rate groups, highest priority first
+_RATE_GROUP RATE_GROUPS[] = {
+    {&timer2, 0, 2},        // READ_FREQ
+    {&timer3, 2, 1},        // CTRL_FREQ
+    {NULL, 3, 1}            // Background
+};
+uint8_t NUM_RATE_GROUPS = sizeof(RATE_GROUPS)/sizeof(RATE_GROUPS[0]);
+
+void release_group(_TIMER *timer) {
+    /*
+    Timer interrupt callback; count a release for the group on this timer
+    */
+    uint8_t i;
+    for (i = 0; i < NUM_RATE_GROUPS; ++i) {
+        if (RATE_GROUPS[i].timer == timer) {
+            RATE_GROUPS[i].released += 1;
+        }
+    }
+}
+
+uint8_t group_due(_RATE_GROUP *group) {
+    return !group->timer || group->released != group->handled;
+}
+
+void init_scheduler() {
+    /*
+    Convert task budgets to timer2 counts; timer2 must already be set up
+    */
+    uint8_t i;
+    for (i = 0; i < NUM_TASKS; ++i) {
+        TASKS[i].budget = ((uint32_t) *(timer2.PRx) + 1) * TASKS[i].budget_pct / 100;
+    }
+}
+
+void run_task(_TASK *task) {
+    /*
+    Run a single task and update its counters
+    */
+    uint16_t start = timer_read(&timer2);
+    task->run();
+    uint16_t stop = timer_read(&timer2);
+    // Runs longer than a reading tick alias, but those also show up as
+    // deadline misses in the READ_FREQ group
+    if (stop < start) {
+        stop += *(timer2.PRx) + 1;
+    }
+    uint16_t cost = stop - start;
+
+    task->runs += 1;
+    if (cost > task->cost_max) {
+        task->cost_max = cost;
+    }
+    if (cost > task->budget) {
+        task->overruns += 1;
+    }
+}
+
+void run_group(uint8_t index) {
+    /*
+    Run every task in a rate group, letting any higher priority group that
+    comes due run in between tasks
+    */
+    uint8_t i, j;
+    _RATE_GROUP *group = &RATE_GROUPS[index];
+
+    // Only the latest release gets run; any others that piled up while the
+    // group waited to start are lost
+    uint16_t released = group->released;
+    if (group->timer) {
+        group->misses += released - group->handled - 1;
+        group->handled = released;
+    }
+
+    for (i = 0; i < group->num_tasks; ++i) {
+        for (j = 0; j < index; ++j) {
+            if (group_due(&RATE_GROUPS[j])) {
+                run_group(j);
+            }
+        }
+        run_task(&TASKS[group->first_task + i]);
+    }
+
+    // The next release came before this one finished
+    if (group->timer && group->released != released) {
+        group->misses += 1;
+    }
+}
+
+void run_scheduler() {
+    /*
+    Run the highest priority rate group that is due
+    */
+    uint8_t i;
+    for (i = 0; i < NUM_RATE_GROUPS; ++i) {
+        if (group_due(&RATE_GROUPS[i])) {
+            run_group(i);
+            return;
+        }
+    }
+}
+
+_RATE_GROUP *task_group(uint8_t task) {
+    /*
+    Return the rate group a task belongs to
+    */
+    uint8_t i;
+    for (i = 0; i < NUM_RATE_GROUPS; ++i) {
+        if (task < RATE_GROUPS[i].first_task + RATE_GROUPS[i].num_tasks) {
+            break;
+        }
+    }
+    return &RATE_GROUPS[i];
+}
+
 void VendorRequests(void) {
     /*
     Handle USB vendor requests
@@ -249,6 +904,151 @@ void VendorRequests(void) {
             BD[EP0IN].bytecount = 0;
             BD[EP0IN].status = 0xC8;
             break;
+        case GET_STATS:
+            ;
+            // Sequence number, then min, max, mean, and RMS for each channel
+            uint8_t i, n = 0;
+            BD[EP0IN].address[n++] = STATS_SEQ.b[0];
+            BD[EP0IN].address[n++] = STATS_SEQ.b[1];
+            for (i = 0; i < NUM_STATS; ++i) {
+                BD[EP0IN].address[n++] = STATS[i].min.b[0];
+                BD[EP0IN].address[n++] = STATS[i].min.b[1];
+                BD[EP0IN].address[n++] = STATS[i].max.b[0];
+                BD[EP0IN].address[n++] = STATS[i].max.b[1];
+                BD[EP0IN].address[n++] = STATS[i].mean.b[0];
+                BD[EP0IN].address[n++] = STATS[i].mean.b[1];
+                BD[EP0IN].address[n++] = STATS[i].rms.b[0];
+                BD[EP0IN].address[n++] = STATS[i].rms.b[1];
+            }
+            BD[EP0IN].bytecount = n;
+            BD[EP0IN].status = 0xC8;
+            break;
+        case GET_OBSERVER:
+            BD[EP0IN].address[0] = OBS_ANGLE.b[0];
+            BD[EP0IN].address[1] = OBS_ANGLE.b[1];
+            BD[EP0IN].address[2] = OBS_VELOCITY.b[0];
+            BD[EP0IN].address[3] = OBS_VELOCITY.b[1];
+            BD[EP0IN].address[4] = OBS_ACCEL.b[0];
+            BD[EP0IN].address[5] = OBS_ACCEL.b[1];
+            BD[EP0IN].address[6] = OBS_TORQUE.b[0];
+            BD[EP0IN].address[7] = OBS_TORQUE.b[1];
+            BD[EP0IN].bytecount = 8;
+            BD[EP0IN].status = 0xC8;
+            break;
+        case GET_OBSERVER_COST:
+            ;
+            // Last and worst-case update time, and the tick length they fit in
+            WORD period = {.w = *(timer2.PRx) + 1};
+            BD[EP0IN].address[0] = OBS_COST & 0xFF;
+            BD[EP0IN].address[1] = OBS_COST >> 8;
+            BD[EP0IN].address[2] = OBS_COST_MAX & 0xFF;
+            BD[EP0IN].address[3] = OBS_COST_MAX >> 8;
+            BD[EP0IN].address[4] = period.b[0];
+            BD[EP0IN].address[5] = period.b[1];
+            BD[EP0IN].bytecount = 6;
+            BD[EP0IN].status = 0xC8;
+            break;
+        case GET_TASK_STATS:
+            ;
+            uint8_t task_index = USB_setup.wValue.b[0];
+            if (task_index >= NUM_TASKS) {
+                USB_error_flags |= 0x01;    // set Request Error Flag
+                break;
+            }
+            _TASK *task = &TASKS[task_index];
+            uint16_t misses = task_group(task_index)->misses;
+            WORD32 runs = {.ul = task->runs};
+            BD[EP0IN].address[0] = runs.b[0];
+            BD[EP0IN].address[1] = runs.b[1];
+            BD[EP0IN].address[2] = runs.b[2];
+            BD[EP0IN].address[3] = runs.b[3];
+            BD[EP0IN].address[4] = task->overruns & 0xFF;
+            BD[EP0IN].address[5] = task->overruns >> 8;
+            BD[EP0IN].address[6] = task->cost_max & 0xFF;
+            BD[EP0IN].address[7] = task->cost_max >> 8;
+            BD[EP0IN].address[8] = task->budget & 0xFF;
+            BD[EP0IN].address[9] = task->budget >> 8;
+            BD[EP0IN].address[10] = misses & 0xFF;
+            BD[EP0IN].address[11] = misses >> 8;
+            BD[EP0IN].bytecount = 12;
+            BD[EP0IN].status = 0xC8;
+            break;
+        case CALIBRATE:
+            start_calibration();
+            BD[EP0IN].bytecount = 0;
+            BD[EP0IN].status = 0xC8;
+            break;
+        case GET_CALIBRATION:
+            ;
+            // State and result, then breakaway duty, Coulomb duty, Coulomb
+            // friction, viscous friction and speed duty for each direction
+            uint8_t dir, cal_n = 0;
+            BD[EP0IN].address[cal_n++] = CAL_STATE;
+            BD[EP0IN].address[cal_n++] = CAL_RESULT;
+            for (dir = 0; dir < 2; ++dir) {
+                BD[EP0IN].address[cal_n++] = CAL_BREAKAWAY[dir] & 0xFF;
+                BD[EP0IN].address[cal_n++] = CAL_BREAKAWAY[dir] >> 8;
+                BD[EP0IN].address[cal_n++] = CAL_COULOMB_DUTY[dir] & 0xFF;
+                BD[EP0IN].address[cal_n++] = CAL_COULOMB_DUTY[dir] >> 8;
+                BD[EP0IN].address[cal_n++] = CAL_COULOMB[dir] & 0xFF;
+                BD[EP0IN].address[cal_n++] = CAL_COULOMB[dir] >> 8;
+                BD[EP0IN].address[cal_n++] = CAL_VISCOUS[dir] & 0xFF;
+                BD[EP0IN].address[cal_n++] = CAL_VISCOUS[dir] >> 8;
+                BD[EP0IN].address[cal_n++] = CAL_SPEED_DUTY[dir] & 0xFF;
+                BD[EP0IN].address[cal_n++] = CAL_SPEED_DUTY[dir] >> 8;
+            }
+            BD[EP0IN].bytecount = cal_n;
+            BD[EP0IN].status = 0xC8;
+            break;
+        case SET_STATS_WINDOW:
+            ;
+            uint16_t window = USB_setup.wValue.w;
+            if (window < 1) {
+                window = 1;
+            } else if (window > STATS_MAX_WINDOW) {
+                window = STATS_MAX_WINDOW;
+            }
+            STATS_WINDOW = window;
+            reset_stats();
+            BD[EP0IN].bytecount = 0;
+            BD[EP0IN].status = 0xC8;
+            break;
+        case SET_CALIBRATION:
+            ;
+            // Restore one friction term saved from GET_CALIBRATION. wIndex
+            // holds the field, in GET_CALIBRATION order, and the direction;
+            // wValue holds the value.
+            uint8_t cal_field = USB_setup.wIndex.b[0];
+            uint8_t cal_dir = USB_setup.wIndex.b[1];
+            uint8_t cal_ok = CAL_STATE == CAL_IDLE && cal_dir < 2;
+            switch (cal_ok ? cal_field : 0xFF) {
+                case 0:
+                    CAL_BREAKAWAY[cal_dir] = USB_setup.wValue.w;
+                    break;
+                case 1:
+                    CAL_COULOMB_DUTY[cal_dir] = USB_setup.wValue.w;
+                    break;
+                case 2:
+                    CAL_COULOMB[cal_dir] = USB_setup.wValue.i;
+                    break;
+                case 3:
+                    CAL_VISCOUS[cal_dir] = USB_setup.wValue.i;
+                    break;
+                case 4:
+                    CAL_SPEED_DUTY[cal_dir] = USB_setup.wValue.i;
+                    break;
+                default:
+                    cal_ok = 0;
+                    break;
+            }
+            if (!cal_ok) {
+                USB_error_flags |= 0x01;    // set Request Error Flag
+                break;
+            }
+            CAL_RESULT = CAL_DONE;
+            BD[EP0IN].bytecount = 0;
+            BD[EP0IN].status = 0xC8;
+            break;
         default:
             USB_error_flags |= 0x01;    // set Request Error Flag
     }
@@ -293,33 +1093,27 @@ int16_t main(void) {
     // Get initial angle offset
     uint8_t unset = 1;
     while (unset) {
-        ANG_OFFSET = enc_readReg((WORD) REG_ANG_ADDR);
+        ANG_OFFSET = enc_readReg((WORD) {.w = REG_ANG_ADDR});
         unset = parity(ANG_OFFSET.w);
     }
     ANG_OFFSET.w &= ENC_MASK;
 
+    // Start the first statistics window
+    reset_stats();
+
     // USB setup
     InitUSB();
     while (USB_USWSTAT!=CONFIG_STATE) {
         ServiceUSB();
     }
 
-    // Timers
-    timer_setFreq(&timer2, READ_FREQ);
-    timer_setFreq(&timer3, CTRL_FREQ);
-    timer_start(&timer2);
-    timer_start(&timer3);
+    // Timers; each interrupt releases its rate group
+    timer_every(&timer2, 1.0 / READ_FREQ, release_group);
+    timer_every(&timer3, 1.0 / CTRL_FREQ, release_group);
+    init_scheduler();
 
     // Main loop
     while (1) {
-        ServiceUSB();
-        if (timer_flag(&timer2)) {
-            timer_lower(&timer2);
-            get_readings();
-        }
-        if (timer_flag(&timer3)) {
-            timer_lower(&timer3);
-            set_velocity();
-        }
+        run_scheduler();
     }
 }
@@ -1,7 +1,10 @@
-import usb.core
+import os
+if os.environ.get('MP2_SIM'):
+    import mp2_sim as usb
+else:
+    import usb.core
 import time
 import csv
-import os.path
 import sys
 import cv2
 import matplotlib.pyplot as plt
@@ -14,6 +17,14 @@ class Joystick:
         self.GET_SPEED     = 4
         self.GET_DIRECTION = 5
         self.SET_PARAMETER = 6
+        self.GET_STATS     = 7
+        self.SET_STATS_WINDOW = 8
+        self.GET_OBSERVER  = 9
+        self.GET_OBSERVER_COST = 10
+        self.GET_TASK_STATS = 11
+        self.CALIBRATE     = 12
+        self.GET_CALIBRATION = 13
+        self.SET_CALIBRATION = 14
 
         self.dev = usb.core.find(idVendor = 0x6666, idProduct = 0x0003)
         if self.dev is None:
@@ -33,6 +44,10 @@ class Joystick:
             self.set_parameter(parameter[1], i)
 
         self.field_names = ['Time', 'Current', 'Angle', 'Velocity', 'Motor_velocity']
+        self.stat_channels = ['Current', 'Angle', 'Velocity']
+        self.calibration_fields = ['Breakaway_duty', 'Coulomb_duty', 'Coulomb', 'Viscous', 'Speed_duty']
+        self.stat_names = ['min', 'max', 'mean', 'rms']
+        self.task_names = ['Sensing', 'Telemetry', 'Control', 'USB']
 
         self.colors = ['b', 'r', 'k', 'g']
         plt.ion()
@@ -120,6 +135,90 @@ class Joystick:
         except usb.core.USBError:
             print "Could not send SET_VALS vendor request."
 
+    def set_stats_window(self, samples):
+        try:
+            self.dev.ctrl_transfer(0x40, self.SET_STATS_WINDOW, samples, 0)
+        except usb.core.USBError:
+            print "Could not send SET_STATS_WINDOW vendor request."
+
+    def get_stats(self):
+        """return the sequence number and min/max/mean/rms of the last completed window"""
+        try:
+            ret = self.dev.ctrl_transfer(0xC0, self.GET_STATS, 0, 0, 2 + 8 * len(self.stat_channels))
+        except usb.core.USBError:
+            print "Could not send GET_STATS vendor request."
+            return
+        words = [self.toWord(ret[i:i + 2]) for i in range(0, len(ret), 2)]
+        stats = {'Seq': words[0]}
+        for i,channel in enumerate(self.stat_channels):
+            values = words[1 + 4 * i:5 + 4 * i]
+            values[:3] = [self.twos_comp(v) for v in values[:3]]  # rms is unsigned
+            stats[channel] = dict(zip(self.stat_names, values))
+        return stats
+
+    def get_observer(self):
+        """return the observer's angle, velocity, acceleration and external torque estimates"""
+        try:
+            ret = self.dev.ctrl_transfer(0xC0, self.GET_OBSERVER, 0, 0, 8)
+        except usb.core.USBError:
+            print "Could not send GET_OBSERVER vendor request."
+            return
+        names = ['Angle', 'Velocity', 'Acceleration', 'Torque']
+        return dict((name, self.twos_comp(self.toWord(ret[2 * i:2 * i + 2]))) for i,name in enumerate(names))
+
+    def get_observer_cost(self):
+        """return the last and worst observer update time as fractions of a reading tick"""
+        try:
+            ret = self.dev.ctrl_transfer(0xC0, self.GET_OBSERVER_COST, 0, 0, 6)
+        except usb.core.USBError:
+            print "Could not send GET_OBSERVER_COST vendor request."
+            return
+        last, worst, period = [self.toWord(ret[i:i + 2]) for i in range(0, 6, 2)]
+        return {'Last': float(last) / period, 'Max': float(worst) / period}
+
+    def get_task_stats(self):
+        """return run, overrun and deadline miss counters for each firmware task"""
+        stats = {}
+        fields = ['overruns', 'cost_max', 'budget', 'misses']
+        for i,name in enumerate(self.task_names):
+            try:
+                ret = self.dev.ctrl_transfer(0xC0, self.GET_TASK_STATS, i, 0, 12)
+            except usb.core.USBError:
+                print "Could not send GET_TASK_STATS vendor request."
+                return
+            stats[name] = dict(zip(fields, [self.toWord(ret[j:j + 2]) for j in range(4, len(ret), 2)]))
+            stats[name]['runs'] = self.toWord(ret[:4])  # 32 bits, the rest are 16
+        return stats
+
+    def calibrate(self):
+        """start the motor dead zone and friction calibration; the joystick will move"""
+        try:
+            self.dev.ctrl_transfer(0x40, self.CALIBRATE, 0, 0)
+        except usb.core.USBError:
+            print "Could not send CALIBRATE vendor request."
+
+    def get_calibration(self):
+        """return whether calibration is running, its result, and the per-direction friction terms"""
+        try:
+            ret = self.dev.ctrl_transfer(0xC0, self.GET_CALIBRATION, 0, 0, 22)
+        except usb.core.USBError:
+            print "Could not send GET_CALIBRATION vendor request."
+            return
+        calibration = {'Running': ret[0] != 0, 'Result': ['none', 'done', 'failed'][ret[1]]}
+        for direction in range(2):
+            words = [self.toWord(ret[i:i + 2]) for i in range(2 + 10 * direction, 12 + 10 * direction, 2)]
+            calibration[direction] = dict(zip(self.calibration_fields, words))
+        return calibration
+
+    def set_calibration(self, calibration):
+        """restore the per-direction friction terms from a saved get_calibration() result"""
+        try:
+            for direction in range(2):
+                for field,name in enumerate(self.calibration_fields):
+                    self.dev.ctrl_transfer(0x40, self.SET_CALIBRATION, calibration[direction][name], field + 256 * direction)
+        except usb.core.USBError:
+            print "Could not send SET_CALIBRATION vendor request."
+
     def get_readings(self):
         now = time.time() - self.inital_time
         current = self.twos_comp(self.toWord(self.get_current()))
@@ -0,0 +1,89 @@
+"""
+Software stand-in for the joystick board, for running the host tools without
+hardware. The firmware is compiled natively against the simulated lib in sim/
+(see sim_SConstruct) and talks to a model of the encoder and motor.
+
+The module mimics the bits of pyusb the host tools use, so it can be dropped
+in with
+
+    import mp2_sim as usb
+
+after which usb.core.find() returns a simulated device and usb.core.USBError
+is raised when the firmware stalls a request.
+
+Which firmware is loaded is picked with the MP2_SIM environment variable
+(mp2, control_test, current_test or wrapping_test; anything else means mp2).
+Set MP2_SIM_FAST=1 to run faster than real time.
+"""
+import array
+import ctypes
+import os
+import sys
+
+FIRMWARES = ['mp2', 'control_test', 'current_test', 'wrapping_test']
+
+class USBError(IOError):
+    pass
+
+class SimDevice:
+    def __init__(self, firmware='mp2', realtime=True):
+        here = os.path.dirname(os.path.abspath(__file__))
+        self.lib = ctypes.CDLL(os.path.join(here, 'lib{}_sim.so'.format(firmware)))
+        self.lib.sim_ctrl_transfer.restype = ctypes.c_int16
+        self.lib.sim_ctrl_transfer.argtypes = [ctypes.c_uint8, ctypes.c_uint8, ctypes.c_uint16,
+                                               ctypes.c_uint16, ctypes.c_uint16, ctypes.c_char_p]
+        self.lib.sim_time.restype = ctypes.c_double
+        self.lib.sim_angle.restype = ctypes.c_double
+        self.lib.sim_set_user_torque.argtypes = [ctypes.c_double]
+        self.idVendor = 0x6666
+        self.idProduct = 0x0003
+        if self.lib.sim_start(int(realtime)) != 0:
+            raise USBError('could not start simulated firmware')
+
+    def set_configuration(self, configuration=None):
+        self.lib.sim_configure()
+
+    def ctrl_transfer(self, bmRequestType, bRequest, wValue=0, wIndex=0, data_or_wLength=None, timeout=None):
+        if bmRequestType & 0x80:
+            wLength = data_or_wLength or 0
+        else:
+            # Data stages of OUT transfers aren't simulated; only the setup packet is sent
+            wLength = len(data_or_wLength) if data_or_wLength else 0
+        buf = ctypes.create_string_buffer(max(wLength, 1))
+        ret = self.lib.sim_ctrl_transfer(bmRequestType, bRequest, wValue, wIndex, wLength, buf)
+        if ret < 0:
+            raise USBError('Pipe error')
+        if bmRequestType & 0x80:
+            return array.array('B', bytearray(buf.raw[:ret]))
+        return wLength
+
+    def set_realtime(self, realtime):
+        self.lib.sim_set_realtime(int(realtime))
+
+    def set_user_torque(self, torque):
+        """apply an external torque in N m, as a hand on the joystick would"""
+        self.lib.sim_set_user_torque(torque)
+
+    def time(self):
+        """simulated time in seconds since power-up"""
+        return self.lib.sim_time()
+
+    def angle(self):
+        """true shaft angle in radians"""
+        return self.lib.sim_angle()
+
+_device = None
+
+def find(idVendor=None, idProduct=None, **kwargs):
+    global _device
+    if (idVendor, idProduct) not in ((None, None), (0x6666, 0x0003)):
+        return None
+    if _device is None:
+        firmware = os.environ.get('MP2_SIM', 'mp2')
+        if firmware not in FIRMWARES:
+            firmware = 'mp2'
+        _device = SimDevice(firmware, realtime=os.environ.get('MP2_SIM_FAST') != '1')
+    return _device
+
+# So that usb.core.find and usb.core.USBError resolve after "import mp2_sim as usb"
+core = sys.modules[__name__]
@@ -0,0 +1,45 @@
+import os
+if os.environ.get('MP2_SIM'):
+    import mp2_sim as usb
+else:
+    import usb.core
+import time
+
+# Reports how much of each 1 kHz reading tick the firmware's state observer
+# uses, as measured on the device with timer2. Under MP2_SIM the figures are
+# host CPU time, not PIC24 time.
+
+class ObserverBench:
+
+    def __init__(self):
+        self.GET_OBSERVER_COST = 10
+        self.dev = usb.core.find(idVendor = 0x6666, idProduct = 0x0003)
+        if self.dev is None:
+            raise ValueError('no USB device found matching idVendor = 0x6666 and idProduct = 0x0003')
+        self.dev.set_configuration()
+
+    def close(self):
+        self.dev = None
+
+    def get_observer_cost(self):
+        try:
+            ret = self.dev.ctrl_transfer(0xC0, self.GET_OBSERVER_COST, 0, 0, 6)
+        except usb.core.USBError:
+            print("Could not send GET_OBSERVER_COST vendor request.")
+        else:
+            return [toWord(ret[i:i + 2]) for i in range(0, 6, 2)]
+
+def toWord(byteArray):
+    val = 0
+    for i,byte in enumerate(byteArray):
+        val += int(byte) * 2**(8*i)
+    return val
+
+# One reading tick is 1/1024 s
+TICK_US = 1e6 / 1024
+
+bench = ObserverBench()
+time.sleep(2)
+last, worst, period = bench.get_observer_cost()
+print('Observer: last {:.2f} us, worst {:.2f} us, {:.2f}% of a {:.0f} us tick'.format(
+    last * TICK_US / period, worst * TICK_US / period, 100.0 * worst / period, TICK_US))
@@ -0,0 +1,33 @@
+#ifndef _COMMON_H_
+#define _COMMON_H_
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#define FALSE   0
+#define TRUE    1
+
+#define FCY     16e6
+
+// Same layout as the device: the static asserts below catch anything that
+// would make the host WORD or WORD32 bigger than on the PIC24
+typedef union {
+    int16_t i;
+    uint16_t w;
+    uint8_t b[2];
+} WORD;
+
+typedef union {
+    int32_t l;
+    uint32_t ul;
+    WORD w[2];
+    uint8_t b[4];
+} WORD32;
+
+_Static_assert(sizeof(WORD) == 2, "WORD must be 2 bytes, as with xc16");
+_Static_assert(sizeof(WORD32) == 4, "WORD32 must be 4 bytes, as with xc16");
+
+void init_clock(void);
+uint16_t parity(uint16_t v);
+
+#endif
@@ -0,0 +1,3 @@
+/*
+Host stand-in for the configuration-bit header.
+*/
@@ -0,0 +1,21 @@
+#ifndef _MD_H_
+#define _MD_H_
+
+#include <stdint.h>
+
+typedef struct {
+    uint8_t braked;
+    uint8_t dir;
+    uint16_t speed;
+} _MD;
+
+extern _MD md1;
+
+void init_md(void);
+void md_free(_MD *self);
+void md_brake(_MD *self);
+void md_speed(_MD *self, uint16_t speed);
+void md_direction(_MD *self, uint8_t dir);
+void md_velocity(_MD *self, uint16_t speed, uint8_t dir);
+
+#endif
@@ -0,0 +1,6 @@
+#ifndef _OC_H_
+#define _OC_H_
+
+void init_oc(void);
+
+#endif
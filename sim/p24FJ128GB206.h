@@ -0,0 +1,4 @@
+/*
+Host stand-in for the PIC24FJ128GB206 device header. The simulated lib
+does not touch special function registers, so there is nothing here.
+*/
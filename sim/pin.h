@@ -0,0 +1,27 @@
+#ifndef _PIN_H_
+#define _PIN_H_
+
+#include <stdint.h>
+
+typedef struct {
+    uint8_t analog;
+    uint8_t output;
+    uint16_t value;     // Last written digital value
+    uint8_t channel;    // Index into A[] for analog pins
+} _PIN;
+
+extern _PIN D[14], A[6];
+
+void init_pin(void);
+
+void pin_digitalIn(_PIN *self);
+void pin_digitalOut(_PIN *self);
+void pin_analogIn(_PIN *self);
+
+void pin_set(_PIN *self);
+void pin_clear(_PIN *self);
+void pin_toggle(_PIN *self);
+void pin_write(_PIN *self, uint16_t val);
+uint16_t pin_read(_PIN *self);
+
+#endif
@@ -0,0 +1,67 @@
+#include <math.h>
+#include "sim.h"
+
+// Motor and joystick parameters, roughly matched to the lab hardware
+#define V_SUPPLY        12.0    // V
+#define R_ARMATURE      6.0     // ohm
+#define K_MOTOR         0.02    // N m / A and V s / rad
+#define INERTIA         2e-5    // kg m^2
+#define B_VISCOUS       1e-5    // N m s / rad
+#define TAU_COULOMB     2.5e-3  // N m
+#define TAU_STATIC      4e-3    // N m, torque needed to break away from rest
+#define OMEGA_STICK     1e-3    // rad / s, below this the shaft counts as at rest
+
+static double ANGLE = 0.0;
+static double OMEGA = 0.0;
+static double CURRENT = 0.0;
+static double USER_TORQUE = 0.0;
+
+void plant_reset(double angle) {
+    /*
+    Put the shaft at rest at the given angle, in radians
+    */
+    ANGLE = angle;
+    OMEGA = 0.0;
+    CURRENT = 0.0;
+}
+
+void plant_step(double dt, double duty) {
+    /*
+    Advance the model by dt seconds with the bridge at the given signed duty
+    */
+    CURRENT = (duty * V_SUPPLY - K_MOTOR * OMEGA) / R_ARMATURE;
+    double drive = K_MOTOR * CURRENT + USER_TORQUE;
+
+    // Stick while the shaft is at rest and the drive can't overcome stiction
+    if (fabs(OMEGA) < OMEGA_STICK && fabs(drive) < TAU_STATIC) {
+        OMEGA = 0.0;
+        return;
+    }
+
+    double direction = OMEGA != 0.0 ? OMEGA : drive;
+    double friction = (direction > 0 ? TAU_COULOMB : -TAU_COULOMB) + B_VISCOUS * OMEGA;
+    double omega = OMEGA + (drive - friction) / INERTIA * dt;
+
+    // Coulomb friction can stop the shaft but never reverse it
+    if ((OMEGA > 0 && omega < 0) || (OMEGA < 0 && omega > 0)) {
+        omega = 0.0;
+    }
+    OMEGA = omega;
+    ANGLE += OMEGA * dt;
+}
+
+double plant_angle(void) {
+    return ANGLE;
+}
+
+double plant_velocity(void) {
+    return OMEGA;
+}
+
+double plant_current(void) {
+    return CURRENT;
+}
+
+void plant_set_user_torque(double torque) {
+    USER_TORQUE = torque;
+}
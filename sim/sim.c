@@ -0,0 +1,572 @@
+/*
+Host implementation of the parts of the elecanisms lib used by the firmware
+in this repository, so that a firmware image can be compiled natively and
+driven from mp2_sim.py instead of over real USB.
+
+The firmware's main() runs unmodified in its own thread. Simulated time moves
+forward by SIM_LOOP_NS every time the main loop calls ServiceUSB(), which is
+also where pending host requests are handed to VendorRequests(), just like on
+the device. It also moves forward by the host CPU time the firmware thread
+spends in its own code, so timer_read() sees firmware code take time; those
+costs are host costs, not PIC24 ones. Timers, the AS5048A encoder on SPI,
+the current sense on A[0] and the motor driver are backed by the model in
+plant.c.
+*/
+#include <math.h>
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+#include "common.h"
+#include "ui.h"
+#include "pin.h"
+#include "spi.h"
+#include "timer.h"
+#include "oc.h"
+#include "md.h"
+#include "usb.h"
+#include "sim.h"
+
+#define ENC_COUNTS      16384
+#define ENC_ANG_ADDR    0x3FFF
+#define ENC_MAG_ADDR    0x3FFE
+#define ENC_DIAG_ADDR   0x3FFD
+
+// The firmware's main(), renamed at compile time
+int16_t firmware_main(void);
+
+_PIN D[14], A[6];
+_PIN led1, led2, led3;
+_PIN sw1, sw2, sw3;
+_SPI spi1, spi2, spi3;
+_TIMER timer1, timer2, timer3, timer4, timer5;
+_MD md1;
+
+uint8_t EP0IN_BUFFER[MAX_PACKET_SIZE];
+BUFDESC BD[2];
+USB_REQUEST USB_request;
+uint8_t USB_error_flags;
+uint8_t USB_USWSTAT;
+
+static _TIMER *TIMERS[] = {&timer1, &timer2, &timer3, &timer4, &timer5};
+
+// Simulation state, owned by the firmware thread
+static uint64_t NOW_NS = 0;
+static uint64_t PLANT_NS = 0;
+static struct timespec CPU_MARK;    // Firmware thread CPU time at the last sim_advance()
+static double ENC_ZERO = 0.0;
+static pthread_t FIRMWARE;
+
+// State shared with the host thread; only touched while holding LOCK
+static uint8_t REALTIME = 1;
+static struct timespec WALL_START;
+static double USER_TORQUE = 0.0;
+static uint64_t SNAPSHOT_NS = 0;    // NOW_NS as of the last sim_advance()
+static double SNAPSHOT_ANGLE = 0.0; // plant_angle() as of the last sim_advance()
+
+// Host request mailbox, serviced from ServiceUSB()
+static pthread_mutex_t LOCK = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t DONE = PTHREAD_COND_INITIALIZER;
+static uint8_t CONFIGURE = 0;
+static uint8_t PENDING = 0;
+static SETUP REQUEST;
+static uint8_t *REQUEST_DATA;
+static int16_t RESULT;
+
+/* ---------------------------------------------------------------- common */
+
+void init_clock(void) {
+}
+
+uint16_t parity(uint16_t v) {
+    /*
+    Return 1 if v has an odd number of set bits
+    */
+    v ^= v >> 8;
+    v ^= v >> 4;
+    v ^= v >> 2;
+    v ^= v >> 1;
+    return v & 1;
+}
+
+/* ------------------------------------------------------------------- pin */
+
+void init_pin(void) {
+    uint8_t i;
+    memset(D, 0, sizeof(D));
+    memset(A, 0, sizeof(A));
+    for (i = 0; i < 6; ++i) {
+        A[i].channel = i;
+    }
+}
+
+void pin_digitalIn(_PIN *self) {
+    self->analog = 0;
+    self->output = 0;
+}
+
+void pin_digitalOut(_PIN *self) {
+    self->analog = 0;
+    self->output = 1;
+}
+
+void pin_analogIn(_PIN *self) {
+    self->analog = 1;
+    self->output = 0;
+}
+
+void pin_set(_PIN *self) {
+    self->value = 1;
+}
+
+void pin_clear(_PIN *self) {
+    self->value = 0;
+}
+
+void pin_toggle(_PIN *self) {
+    self->value = !self->value;
+}
+
+void pin_write(_PIN *self, uint16_t val) {
+    self->value = val;
+}
+
+uint16_t pin_read(_PIN *self) {
+    /*
+    A[0] is the motor current sense: 1.65 V at zero current, 0.75 V per amp,
+    left-justified to 16 bits over the 3.3 V range
+    */
+    if (self->analog && self == &A[0]) {
+        double volts = 1.65 + 0.75 * plant_current();
+        double counts = volts / 3.3 * 65535.0;
+        if (counts < 0.0) {
+            counts = 0.0;
+        } else if (counts > 65535.0) {
+            counts = 65535.0;
+        }
+        return ((uint16_t) counts) & 0xFFC0;
+    }
+    return self->value;
+}
+
+/* -------------------------------------------------------------------- ui */
+
+void init_ui(void) {
+    led1.value = led2.value = led3.value = 0;
+    sw1.value = sw2.value = sw3.value = 1;  // Switches are active low
+}
+
+void led_on(_PIN *led) {
+    led->value = 1;
+}
+
+void led_off(_PIN *led) {
+    led->value = 0;
+}
+
+void led_toggle(_PIN *led) {
+    led->value = !led->value;
+}
+
+uint8_t sw_read(_PIN *sw) {
+    return sw->value;
+}
+
+/* ------------------------------------------------------------------- spi */
+
+static uint16_t enc_register(uint16_t address) {
+    /*
+    Return the AS5048A response frame for a read of the given register
+    */
+    uint16_t data = 0;
+    if (address == ENC_ANG_ADDR) {
+        double turns = (plant_angle() + ENC_ZERO) / (2.0 * M_PI);
+        turns -= floor(turns);
+        data = ((uint16_t) (turns * ENC_COUNTS)) & 0x3FFF;
+    } else if (address == ENC_MAG_ADDR) {
+        data = 0x1000;
+    } else if (address == ENC_DIAG_ADDR) {
+        data = 0x0180;  // OCF and COF set, AGC at mid-scale
+    }
+    return data | (parity(data) << 15);
+}
+
+void init_spi(void) {
+    memset(&spi1, 0, sizeof(spi1));
+    memset(&spi2, 0, sizeof(spi2));
+    memset(&spi3, 0, sizeof(spi3));
+}
+
+void spi_open(_SPI *self, _PIN *MISO, _PIN *MOSI, _PIN *SCK, float freq, uint8_t mode) {
+    self->phase = 0;
+    self->command = 0;
+    self->response = 0;
+}
+
+void spi_close(_SPI *self) {
+}
+
+uint8_t spi_transfer(_SPI *self, uint8_t val) {
+    /*
+    Clock one byte through the encoder. Like the AS5048A, the answer to a
+    read command comes back during the following 16-bit frame.
+    */
+    uint8_t out;
+    if (self->phase == 0) {
+        out = self->response >> 8;
+        self->command = val << 8;
+        self->phase = 1;
+    } else {
+        out = self->response & 0xFF;
+        self->command |= val;
+        self->phase = 0;
+        if (self->command & 0x4000) {
+            self->response = enc_register(self->command & 0x3FFF);
+        } else {
+            self->response = 0;
+        }
+    }
+    return out;
+}
+
+/* ----------------------------------------------------------------- timer */
+
+static uint64_t cpu_elapsed_ns(void) {
+    /*
+    Return the CPU time the firmware thread has used since the last sim_advance()
+    */
+    struct timespec now;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+    return (now.tv_sec - CPU_MARK.tv_sec) * 1000000000LL + (now.tv_nsec - CPU_MARK.tv_nsec);
+}
+
+void init_timer(void) {
+    uint8_t i;
+    for (i = 0; i < 5; ++i) {
+        memset(TIMERS[i], 0, sizeof(_TIMER));
+        TIMERS[i]->PRx = &TIMERS[i]->PR;
+        TIMERS[i]->TMRx = &TIMERS[i]->TMR;
+        TIMERS[i]->prescaler = 1;
+    }
+}
+
+void timer_setPeriod(_TIMER *self, float period) {
+    /*
+    Pick the smallest prescaler that fits the period in 16 bits, as the
+    PIC24 lib does
+    */
+    static const uint16_t prescalers[] = {1, 8, 64, 256};
+    double ticks = period * FCY;
+    uint8_t i;
+    for (i = 0; i < 3 && ticks / prescalers[i] > 65536.0; ++i) {
+    }
+    self->prescaler = prescalers[i];
+    self->PR = (uint16_t) (ticks / prescalers[i] - 1.0);
+    self->period_ns = (uint64_t) ((self->PR + 1.0) * self->prescaler / FCY * 1e9);
+    self->start_ns = NOW_NS;
+    self->TMR = 0;
+}
+
+float timer_period(_TIMER *self) {
+    return self->period_ns * 1e-9;
+}
+
+void timer_setFreq(_TIMER *self, float freq) {
+    timer_setPeriod(self, 1.0 / freq);
+}
+
+float timer_freq(_TIMER *self) {
+    return 1e9 / self->period_ns;
+}
+
+uint16_t timer_read(_TIMER *self) {
+    if (self->running && self->period_ns) {
+        uint64_t elapsed = (NOW_NS + cpu_elapsed_ns() - self->start_ns) % self->period_ns;
+        self->TMR = (uint16_t) (elapsed * (self->PR + 1) / self->period_ns);
+    }
+    return self->TMR;
+}
+
+void timer_start(_TIMER *self) {
+    self->flag = 0;
+    self->start_ns = NOW_NS;
+    self->running = 1;
+}
+
+void timer_stop(_TIMER *self) {
+    self->running = 0;
+}
+
+uint8_t timer_flag(_TIMER *self) {
+    return self->flag;
+}
+
+void timer_lower(_TIMER *self) {
+    self->flag = 0;
+}
+
+void timer_every(_TIMER *self, float interval, void (*callback)(_TIMER *self)) {
+    timer_stop(self);
+    timer_setPeriod(self, interval);
+    self->every = callback;
+    self->after = NULL;
+    timer_start(self);
+}
+
+void timer_after(_TIMER *self, float delay, uint16_t num_times, void (*callback)(_TIMER *self)) {
+    timer_stop(self);
+    timer_setPeriod(self, delay);
+    self->aftercount = num_times;
+    self->every = NULL;
+    self->after = callback;
+    timer_start(self);
+}
+
+void timer_cancel(_TIMER *self) {
+    timer_stop(self);
+    self->every = NULL;
+    self->after = NULL;
+}
+
+static void timer_advance(_TIMER *self) {
+    /*
+    Roll the timer over as many times as simulated time requires, raising the
+    flag and running callbacks as the interrupt would
+    */
+    while (self->running && self->period_ns && NOW_NS - self->start_ns >= self->period_ns) {
+        self->start_ns += self->period_ns;
+        self->flag = 1;
+        if (self->every) {
+            self->every(self);
+        } else if (self->after) {
+            if (--self->aftercount == 0) {
+                self->running = 0;
+                self->after(self);
+            }
+        }
+    }
+}
+
+/* -------------------------------------------------------------- oc / md */
+
+void init_oc(void) {
+}
+
+void init_md(void) {
+    memset(&md1, 0, sizeof(md1));
+}
+
+void md_free(_MD *self) {
+    self->braked = 0;
+    self->speed = 0;
+}
+
+void md_brake(_MD *self) {
+    self->braked = 1;
+    self->speed = 0;
+}
+
+void md_speed(_MD *self, uint16_t speed) {
+    self->braked = 0;
+    self->speed = speed;
+}
+
+void md_direction(_MD *self, uint8_t dir) {
+    self->dir = dir;
+}
+
+void md_velocity(_MD *self, uint16_t speed, uint8_t dir) {
+    md_direction(self, dir);
+    md_speed(self, speed);
+}
+
+static double md_duty(void) {
+    /*
+    Signed bridge duty; direction 1 drives the angle down
+    */
+    double duty = md1.speed / 65535.0;
+    return md1.dir ? -duty : duty;
+}
+
+/* ------------------------------------------------------------------- usb */
+
+void InitUSB(void) {
+    BD[EP0IN].address = EP0IN_BUFFER;
+    BD[EP0IN].bytecount = 0;
+    BD[EP0IN].status = 0;
+    USB_USWSTAT = 0;
+}
+
+static void sim_pace(struct timespec start) {
+    /*
+    Hold simulated time back to wall-clock time, counted from start
+    */
+    struct timespec now, wait;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    int64_t wall_ns = (now.tv_sec - start.tv_sec) * 1000000000LL
+                      + (now.tv_nsec - start.tv_nsec);
+    int64_t ahead_ns = (int64_t) NOW_NS - wall_ns;
+    // Sleeping every loop would cost more than the loop itself
+    if (ahead_ns > 1000000) {
+        wait.tv_sec = ahead_ns / 1000000000LL;
+        wait.tv_nsec = ahead_ns % 1000000000LL;
+        nanosleep(&wait, NULL);
+    }
+}
+
+static void sim_advance(uint64_t ns) {
+    uint8_t i, realtime;
+    struct timespec start;
+    NOW_NS += ns + cpu_elapsed_ns();
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &CPU_MARK);
+    pthread_mutex_lock(&LOCK);
+    plant_set_user_torque(USER_TORQUE);
+    realtime = REALTIME;
+    start = WALL_START;
+    pthread_mutex_unlock(&LOCK);
+    while (PLANT_NS + SIM_PLANT_NS <= NOW_NS) {
+        plant_step(SIM_PLANT_NS * 1e-9, md1.braked ? 0.0 : md_duty());
+        PLANT_NS += SIM_PLANT_NS;
+    }
+    for (i = 0; i < 5; ++i) {
+        timer_advance(TIMERS[i]);
+    }
+
+    pthread_mutex_lock(&LOCK);
+    SNAPSHOT_NS = NOW_NS;
+    SNAPSHOT_ANGLE = plant_angle();
+    pthread_mutex_unlock(&LOCK);
+
+    if (realtime) {
+        sim_pace(start);
+    }
+}
+
+void ServiceUSB(void) {
+    sim_advance(SIM_LOOP_NS);
+
+    pthread_mutex_lock(&LOCK);
+    if (CONFIGURE) {
+        USB_USWSTAT = CONFIG_STATE;
+        CONFIGURE = 0;
+        pthread_cond_broadcast(&DONE);
+    }
+    if (PENDING) {
+        USB_request.setup = REQUEST;
+        USB_error_flags = 0;
+        BD[EP0IN].bytecount = 0;
+        BD[EP0IN].status = 0;
+        VendorRequests();
+
+        if (USB_error_flags & 0x01) {
+            RESULT = -1;
+        } else if (REQUEST.bmRequestType & 0x80) {
+            RESULT = BD[EP0IN].bytecount;
+            if (RESULT > REQUEST.wLength.w) {
+                RESULT = REQUEST.wLength.w;
+            }
+            memcpy(REQUEST_DATA, BD[EP0IN].address, RESULT);
+        } else {
+            RESULT = 0;
+        }
+        PENDING = 0;
+        pthread_cond_broadcast(&DONE);
+    }
+    pthread_mutex_unlock(&LOCK);
+}
+
+/* ------------------------------------------------------------------ host */
+
+static void *sim_run(void *arg) {
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &CPU_MARK);
+    firmware_main();
+    return NULL;
+}
+
+int sim_start(uint8_t realtime) {
+    /*
+    Power up the simulated board and start the firmware
+    */
+    REALTIME = realtime;
+    clock_gettime(CLOCK_MONOTONIC, &WALL_START);
+    init_timer();
+    init_pin();
+    init_md();
+    BD[EP0IN].address = EP0IN_BUFFER;
+    // The magnet isn't aligned with the encoder's zero
+    ENC_ZERO = 1.234;
+    plant_reset(0.0);
+    return pthread_create(&FIRMWARE, NULL, sim_run, NULL);
+}
+
+void sim_set_realtime(uint8_t realtime) {
+    pthread_mutex_lock(&LOCK);
+    REALTIME = realtime;
+    // Re-anchor wall-clock time so a fast-forwarded sim doesn't stall
+    clock_gettime(CLOCK_MONOTONIC, &WALL_START);
+    WALL_START.tv_sec -= SNAPSHOT_NS / 1000000000ULL;
+    WALL_START.tv_nsec -= SNAPSHOT_NS % 1000000000ULL;
+    if (WALL_START.tv_nsec < 0) {
+        WALL_START.tv_nsec += 1000000000L;
+        WALL_START.tv_sec -= 1;
+    }
+    pthread_mutex_unlock(&LOCK);
+}
+
+void sim_configure(void) {
+    /*
+    Stand in for enumeration and SET_CONFIGURATION from the host
+    */
+    pthread_mutex_lock(&LOCK);
+    CONFIGURE = 1;
+    while (CONFIGURE) {
+        pthread_cond_wait(&DONE, &LOCK);
+    }
+    pthread_mutex_unlock(&LOCK);
+}
+
+int16_t sim_ctrl_transfer(uint8_t bmRequestType, uint8_t bRequest, uint16_t wValue,
+                          uint16_t wIndex, uint16_t wLength, uint8_t *data) {
+    /*
+    Run a vendor control transfer through the firmware. Returns the number of
+    bytes placed in data for IN transfers, 0 for OUT transfers, or -1 if the
+    firmware stalled the request.
+    */
+    int16_t result;
+    pthread_mutex_lock(&LOCK);
+    while (PENDING) {
+        pthread_cond_wait(&DONE, &LOCK);
+    }
+    REQUEST.bmRequestType = bmRequestType;
+    REQUEST.bRequest = bRequest;
+    REQUEST.wValue.w = wValue;
+    REQUEST.wIndex.w = wIndex;
+    REQUEST.wLength.w = wLength;
+    REQUEST_DATA = data;
+    PENDING = 1;
+    while (PENDING) {
+        pthread_cond_wait(&DONE, &LOCK);
+    }
+    result = RESULT;
+    pthread_mutex_unlock(&LOCK);
+    return result;
+}
+
+double sim_time(void) {
+    pthread_mutex_lock(&LOCK);
+    double now = SNAPSHOT_NS * 1e-9;
+    pthread_mutex_unlock(&LOCK);
+    return now;
+}
+
+void sim_set_user_torque(double torque) {
+    pthread_mutex_lock(&LOCK);
+    USER_TORQUE = torque;
+    pthread_mutex_unlock(&LOCK);
+}
+
+double sim_angle(void) {
+    pthread_mutex_lock(&LOCK);
+    double angle = SNAPSHOT_ANGLE;
+    pthread_mutex_unlock(&LOCK);
+    return angle;
+}
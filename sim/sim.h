@@ -0,0 +1,29 @@
+#ifndef _SIM_H_
+#define _SIM_H_
+
+#include <stdint.h>
+
+// Nominal length of one pass through a firmware main loop
+#define SIM_LOOP_NS     20000
+// Integration step for the motor and encoder model
+#define SIM_PLANT_NS    10000
+
+// Host-facing interface of a simulated firmware image, used by mp2_sim.py
+int sim_start(uint8_t realtime);
+void sim_set_realtime(uint8_t realtime);
+void sim_configure(void);
+int16_t sim_ctrl_transfer(uint8_t bmRequestType, uint8_t bRequest, uint16_t wValue,
+                          uint16_t wIndex, uint16_t wLength, uint8_t *data);
+double sim_time(void);
+void sim_set_user_torque(double torque);
+double sim_angle(void);
+
+// Motor, gearbox, encoder and current sense model
+void plant_reset(double angle);
+void plant_step(double dt, double duty);
+double plant_angle(void);
+double plant_velocity(void);
+double plant_current(void);
+void plant_set_user_torque(double torque);
+
+#endif
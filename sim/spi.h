@@ -0,0 +1,20 @@
+#ifndef _SPI_H_
+#define _SPI_H_
+
+#include <stdint.h>
+#include "pin.h"
+
+typedef struct {
+    uint8_t phase;      // Byte position within the current 16-bit frame
+    uint16_t command;   // Command shifted in during the current frame
+    uint16_t response;  // Value shifted out during the current frame
+} _SPI;
+
+extern _SPI spi1, spi2, spi3;
+
+void init_spi(void);
+void spi_open(_SPI *self, _PIN *MISO, _PIN *MOSI, _PIN *SCK, float freq, uint8_t mode);
+void spi_close(_SPI *self);
+uint8_t spi_transfer(_SPI *self, uint8_t val);
+
+#endif
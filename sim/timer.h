@@ -0,0 +1,38 @@
+#ifndef _TIMER_H_
+#define _TIMER_H_
+
+#include <stdint.h>
+
+typedef struct _TIMER {
+    uint16_t *PRx;
+    uint16_t *TMRx;
+    uint16_t PR;            // Storage behind PRx
+    uint16_t TMR;           // Storage behind TMRx
+    uint16_t prescaler;
+    uint8_t running;
+    uint8_t flag;
+    uint64_t start_ns;      // Simulated time of the last rollover
+    uint64_t period_ns;
+    uint16_t aftercount;
+    void (*every)(struct _TIMER *self);
+    void (*after)(struct _TIMER *self);
+} _TIMER;
+
+extern _TIMER timer1, timer2, timer3, timer4, timer5;
+
+void init_timer(void);
+
+void timer_setPeriod(_TIMER *self, float period);
+float timer_period(_TIMER *self);
+void timer_setFreq(_TIMER *self, float freq);
+float timer_freq(_TIMER *self);
+uint16_t timer_read(_TIMER *self);
+void timer_start(_TIMER *self);
+void timer_stop(_TIMER *self);
+uint8_t timer_flag(_TIMER *self);
+void timer_lower(_TIMER *self);
+void timer_every(_TIMER *self, float interval, void (*callback)(_TIMER *self));
+void timer_after(_TIMER *self, float delay, uint16_t num_times, void (*callback)(_TIMER *self));
+void timer_cancel(_TIMER *self);
+
+#endif
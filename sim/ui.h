@@ -0,0 +1,17 @@
+#ifndef _UI_H_
+#define _UI_H_
+
+#include <stdint.h>
+#include "pin.h"
+
+extern _PIN led1, led2, led3;
+extern _PIN sw1, sw2, sw3;
+
+void init_ui(void);
+
+void led_on(_PIN *led);
+void led_off(_PIN *led);
+void led_toggle(_PIN *led);
+uint8_t sw_read(_PIN *sw);
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef _USB_H_
+#define _USB_H_
+
+#include <stdint.h>
+#include "common.h"
+
+#define EP0IN           1
+#define CONFIG_STATE    4
+#define MAX_PACKET_SIZE 64
+
+typedef struct {
+    uint8_t status;
+    uint8_t bytecount;
+    uint8_t *address;
+} BUFDESC;
+
+typedef struct {
+    uint8_t bmRequestType;
+    uint8_t bRequest;
+    WORD wValue;
+    WORD wIndex;
+    WORD wLength;
+} SETUP;
+
+typedef struct {
+    SETUP setup;
+} USB_REQUEST;
+
+extern BUFDESC BD[2];
+extern USB_REQUEST USB_request;
+extern uint8_t USB_error_flags;
+extern uint8_t USB_USWSTAT;
+
+#define USB_setup   USB_request.setup
+
+void InitUSB(void);
+void ServiceUSB(void);
+
+// Provided by the firmware
+void VendorRequests(void);
+void VendorRequestsIn(void);
+void VendorRequestsOut(void);
+
+#endif
@@ -18,10 +18,10 @@
 _PIN *ENC_SCK, *ENC_MISO, *ENC_MOSI;
 _PIN *ENC_NCS;
 
-WORD OFFSET = (WORD) 0;
-WORD CURRENT_ANGLE = (WORD) 0;
-WORD LAST_ANGLE = (WORD) 0;
-WORD UNWRAPPED_ANGLE = (WORD) 0;
+WORD OFFSET = {0};
+WORD CURRENT_ANGLE = {0};
+WORD LAST_ANGLE = {0};
+WORD UNWRAPPED_ANGLE = {0};
 int8_t WRAPS = 0;
 
 void check_wraps() {
@@ -61,7 +61,7 @@ WORD enc_readReg(WORD address) {
 }
 
 WORD enc_getAngle() {
-    WORD result = enc_readReg((WORD) REG_ANG_ADDR);
+    WORD result = enc_readReg((WORD) {.w = REG_ANG_ADDR});
     // If the parity of the result is wrong, don't use the result
     if (parity(result.w)) {
         return LAST_ANGLE;
@@ -1,4 +1,8 @@
-import usb.core
+import os
+if os.environ.get('MP2_SIM'):
+    import mp2_sim as usb
+else:
+    import usb.core
 import time
 
 class encodertest: